@@ -0,0 +1,209 @@
+/*
+  ==============================================================================
+
+    DecodeAheadSource.h
+
+    Moves decoding off the audio thread: a background thread keeps a ring
+    buffer filled ahead of the playhead.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "DecodedAudioCache.h"
+
+//==============================================================================
+/**
+    Wraps a positionable source and decodes it on a TimeSliceThread into a ring
+    buffer, so that the audio callback only ever copies samples.
+
+    The ring is a single-producer, single-consumer AbstractFifo and the audio
+    callback never takes a lock. A seek is handed over through atomics: the
+    decode thread stops writing and acknowledges it, the callback then drops
+    whatever is left in the ring, and only after that does decoding resume from
+    the new position.
+
+    If the decode thread falls behind, the missing part of the block is
+    silenced and counted as an underrun rather than being decoded inline.
+*/
+class DecodeAheadSource   : public juce::PositionableAudioSource,
+                            private juce::TimeSliceClient
+{
+public:
+    DecodeAheadSource (std::unique_ptr<juce::PositionableAudioSource> sourceToUse,
+                       juce::TimeSliceThread& threadToUse,
+                       int numChannelsToBuffer,
+                       int samplesToReadAhead = 1 << 15,
+                       int samplesPerDecodeBlock = 4096)
+        : source (std::move (sourceToUse)),
+          thread (threadToUse),
+          ringBuffer (juce::jmax (1, numChannelsToBuffer), samplesToReadAhead),
+          fifo (samplesToReadAhead),
+          scratch (juce::jmax (1, numChannelsToBuffer), samplesPerDecodeBlock)
+    {
+        thread.addTimeSliceClient (this);
+    }
+
+    ~DecodeAheadSource() override
+    {
+        thread.removeTimeSliceClient (this);
+    }
+
+    juce::PositionableAudioSource* getSource() const noexcept    { return source.get(); }
+
+    /** The number of blocks that had to be (partly) filled with silence because
+        the decode thread hadn't caught up yet.
+    */
+    int getNumUnderruns() const noexcept                          { return underruns.load(); }
+    void resetUnderrunCount() noexcept                            { underruns = 0; }
+
+    //==========================================================================
+    // The wrapped source is only ever prepared or released while the decode
+    // thread isn't registered, because removeTimeSliceClient() waits for a
+    // useTimeSlice() that's still reading from it
+    void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
+    {
+        thread.removeTimeSliceClient (this);
+        source->prepareToPlay (samplesPerBlockExpected, sampleRate);
+        thread.addTimeSliceClient (this);
+        thread.moveToFrontOfQueue (this);
+    }
+
+    void releaseResources() override
+    {
+        thread.removeTimeSliceClient (this);
+        source->releaseResources();
+    }
+
+    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        auto* buffer = bufferToFill.buffer;
+        auto seek = seekGeneration.load (std::memory_order_acquire);
+
+        if (seek != consumerGeneration.load (std::memory_order_relaxed))
+        {
+            // wait until the decode thread has stopped writing samples from
+            // before the seek, then throw away everything still in the ring
+            if (producerGeneration.load (std::memory_order_acquire) != seek)
+            {
+                bufferToFill.clearActiveBufferRegion();
+                return;
+            }
+
+            fifo.finishedRead (fifo.getNumReady());
+            nextPlayPosition = seekPosition.load();
+            hasBeenFilled = false;
+            consumerGeneration.store (seek, std::memory_order_release);
+        }
+
+        auto numWanted = bufferToFill.numSamples;
+        auto numDone = 0;
+
+        {
+            const auto read = fifo.read (numWanted);
+
+            auto copyRegion = [&] (int ringStart, int size)
+            {
+                for (int ch = 0; ch < buffer->getNumChannels(); ++ch)
+                    buffer->copyFrom (ch, bufferToFill.startSample + numDone, ringBuffer,
+                                      juce::jmin (ch, ringBuffer.getNumChannels() - 1), ringStart, size);
+
+                numDone += size;
+            };
+
+            if (read.blockSize1 > 0)  copyRegion (read.startIndex1, read.blockSize1);
+            if (read.blockSize2 > 0)  copyRegion (read.startIndex2, read.blockSize2);
+        }
+
+        if (numDone > 0)
+            hasBeenFilled = true;
+
+        if (numDone < numWanted)
+        {
+            buffer->clear (bufferToFill.startSample + numDone, numWanted - numDone);
+
+            // a gap straight after a seek is the ring refilling, and one past
+            // the end is just the file running out
+            if (hasBeenFilled && (isLooping() || nextPlayPosition + numDone < getTotalLength()))
+                ++underruns;
+        }
+
+        // like BufferingAudioSource, the playhead moves on by the whole block,
+        // so AudioTransportSource can see the end of the stream
+        nextPlayPosition += numWanted;
+    }
+
+    //==========================================================================
+    void setNextReadPosition (juce::int64 newPosition) override
+    {
+        seekPosition = newPosition;
+        seekGeneration.fetch_add (1, std::memory_order_acq_rel);
+        thread.moveToFrontOfQueue (this);
+    }
+
+    juce::int64 getNextReadPosition() const override
+    {
+        auto seekPending = seekGeneration.load() != consumerGeneration.load();
+        auto pos = seekPending ? seekPosition.load() : nextPlayPosition.load();
+        auto length = getTotalLength();
+
+        return isLooping() && length > 0 ? pos % length : pos;
+    }
+
+    juce::int64 getTotalLength() const override         { return source->getTotalLength(); }
+    bool isLooping() const override                     { return source->isLooping(); }
+    void setLooping (bool shouldLoop) override          { source->setLooping (shouldLoop); }
+
+private:
+    int useTimeSlice() override
+    {
+        auto seek = seekGeneration.load (std::memory_order_acquire);
+
+        if (seek != producerGeneration.load (std::memory_order_relaxed))
+        {
+            // nothing more gets written until the callback has flushed the ring
+            producerGeneration.store (seek, std::memory_order_release);
+            nextDecodePosition = seekPosition.load();
+        }
+
+        if (consumerGeneration.load (std::memory_order_acquire) != seek)
+            return 2;
+
+        auto numToDecode = juce::jmin (fifo.getFreeSpace(), scratch.getNumSamples());
+
+        if (numToDecode < scratch.getNumSamples() / 2)
+            return 5;
+
+        if (! isLooping() && nextDecodePosition >= getTotalLength())
+            return 20;
+
+        source->setNextReadPosition (nextDecodePosition);
+        source->getNextAudioBlock ({ &scratch, 0, numToDecode });
+
+        const auto write = fifo.write (numToDecode);
+
+        for (int ch = 0; ch < ringBuffer.getNumChannels(); ++ch)
+        {
+            if (write.blockSize1 > 0)  ringBuffer.copyFrom (ch, write.startIndex1, scratch, ch, 0, write.blockSize1);
+            if (write.blockSize2 > 0)  ringBuffer.copyFrom (ch, write.startIndex2, scratch, ch, write.blockSize1, write.blockSize2);
+        }
+
+        nextDecodePosition += numToDecode;
+        return 0;
+    }
+
+    std::unique_ptr<juce::PositionableAudioSource> source;
+    juce::TimeSliceThread& thread;
+    juce::AudioBuffer<float> ringBuffer;
+    juce::AbstractFifo fifo;
+    juce::AudioBuffer<float> scratch;
+
+    std::atomic<juce::int64> seekPosition { 0 }, nextPlayPosition { 0 };
+    std::atomic<int> seekGeneration { 0 }, producerGeneration { 0 }, consumerGeneration { 0 };
+    juce::int64 nextDecodePosition = 0;     // decode thread only
+    bool hasBeenFilled = false;             // audio thread only
+    std::atomic<int> underruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DecodeAheadSource)
+};
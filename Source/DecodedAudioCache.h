@@ -0,0 +1,464 @@
+/*
+  ==============================================================================
+
+    DecodedAudioCache.h
+
+    An in-memory, size-bounded cache of decoded audio, plus a positionable
+    source that plays files out of it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <list>
+#include <map>
+
+//==============================================================================
+/**
+    Holds decoded PCM for recently used files, split into fixed-size chunks so
+    that partially read files can be cached too.
+
+    Once the memory budget is exceeded the least recently used chunks are
+    dropped. Chunks are handed out as shared pointers, so a chunk that gets
+    evicted while a reader is still copying from it stays valid until that
+    reader lets go of it.
+*/
+class DecodedAudioCache
+{
+public:
+    static constexpr int samplesPerChunk = 1 << 16;
+
+    using Chunk = std::shared_ptr<const juce::AudioBuffer<float>>;
+
+    struct FileInfo
+    {
+        double sampleRate = 0.0;
+        juce::int64 lengthInSamples = 0;
+        int numChannels = 0;
+    };
+
+    struct Statistics
+    {
+        juce::int64 hits = 0, misses = 0, evictions = 0;
+        size_t bytesInUse = 0, memoryBudget = 0;
+        int numChunks = 0;
+    };
+
+    explicit DecodedAudioCache (size_t maxBytes = 256 * 1024 * 1024)
+        : memoryBudget (maxBytes)
+    {
+    }
+
+    //==========================================================================
+    void setMemoryBudget (size_t maxBytes)
+    {
+        const juce::ScopedLock sl (lock);
+        memoryBudget = maxBytes;
+        evictUntilWithinBudget();
+    }
+
+    size_t getMemoryBudget() const
+    {
+        const juce::ScopedLock sl (lock);
+        return memoryBudget;
+    }
+
+    //==========================================================================
+    bool getFileInfo (const juce::File& file, FileInfo& result) const
+    {
+        const juce::ScopedLock sl (lock);
+        auto it = fileInfos.find (file.getFullPathName());
+
+        if (it == fileInfos.end())
+            return false;
+
+        result = it->second;
+        return true;
+    }
+
+    void setFileInfo (const juce::File& file, const FileInfo& info)
+    {
+        const juce::ScopedLock sl (lock);
+        fileInfos[file.getFullPathName()] = info;
+    }
+
+    /** Returns a small number identifying the file, used as the chunk key so
+        that lookups on the audio thread don't have to build or compare paths.
+    */
+    int getFileId (const juce::File& file)
+    {
+        const juce::ScopedLock sl (lock);
+        auto path = file.getFullPathName();
+        auto it = fileIds.find (path);
+
+        if (it != fileIds.end())
+            return it->second;
+
+        auto id = (int) fileIds.size();
+        fileIds[path] = id;
+        return id;
+    }
+
+    //==========================================================================
+    /** Returns the chunk if it's cached (and marks it as recently used), or
+        nullptr otherwise. Both outcomes are counted in the statistics.
+    */
+    Chunk getChunk (int fileId, juce::int64 chunkIndex)
+    {
+        const juce::ScopedLock sl (lock);
+        auto it = chunks.find ({ fileId, chunkIndex });
+
+        if (it == chunks.end())
+        {
+            ++misses;
+            return {};
+        }
+
+        ++hits;
+        lru.splice (lru.begin(), lru, it->second.lruPosition);
+        return it->second.data;
+    }
+
+    /** Checks for a chunk without touching the statistics or the LRU order. */
+    bool containsChunk (int fileId, juce::int64 chunkIndex) const
+    {
+        const juce::ScopedLock sl (lock);
+        return chunks.find ({ fileId, chunkIndex }) != chunks.end();
+    }
+
+    Chunk addChunk (int fileId, juce::int64 chunkIndex, juce::AudioBuffer<float>&& data)
+    {
+        auto chunk = std::make_shared<const juce::AudioBuffer<float>> (std::move (data));
+        auto numBytes = getSizeInBytes (*chunk);
+        Key key { fileId, chunkIndex };
+
+        const juce::ScopedLock sl (lock);
+        auto existing = chunks.find (key);
+
+        if (existing != chunks.end())
+        {
+            // someone else decoded the same region in the meantime
+            lru.splice (lru.begin(), lru, existing->second.lruPosition);
+            return existing->second.data;
+        }
+
+        lru.push_front (key);
+        chunks[key] = { chunk, lru.begin() };
+        bytesInUse += numBytes;
+        evictUntilWithinBudget();
+        return chunk;
+    }
+
+    //==========================================================================
+    Statistics getStatistics() const
+    {
+        const juce::ScopedLock sl (lock);
+
+        Statistics s;
+        s.hits = hits;
+        s.misses = misses;
+        s.evictions = evictions;
+        s.bytesInUse = bytesInUse;
+        s.memoryBudget = memoryBudget;
+        s.numChunks = (int) chunks.size();
+        return s;
+    }
+
+    void resetStatistics()
+    {
+        const juce::ScopedLock sl (lock);
+        hits = misses = evictions = 0;
+    }
+
+    void clear()
+    {
+        const juce::ScopedLock sl (lock);
+        chunks.clear();
+        lru.clear();
+        fileInfos.clear();
+        // ids stay valid, as sources may still be holding on to them
+        bytesInUse = 0;
+    }
+
+private:
+    using Key = std::pair<int, juce::int64>;
+
+    struct Entry
+    {
+        Chunk data;
+        std::list<Key>::iterator lruPosition;
+    };
+
+    static size_t getSizeInBytes (const juce::AudioBuffer<float>& b) noexcept
+    {
+        return (size_t) b.getNumChannels() * (size_t) b.getNumSamples() * sizeof (float);
+    }
+
+    void evictUntilWithinBudget()
+    {
+        // never evict the most recent chunk, or a budget smaller than one
+        // chunk would make the cache useless
+        while (bytesInUse > memoryBudget && lru.size() > 1)
+        {
+            auto it = chunks.find (lru.back());
+            bytesInUse -= getSizeInBytes (*it->second.data);
+            chunks.erase (it);
+            lru.pop_back();
+            ++evictions;
+        }
+    }
+
+    juce::CriticalSection lock;
+    std::map<Key, Entry> chunks;
+    std::list<Key> lru;
+    std::map<juce::String, FileInfo> fileInfos;
+    std::map<juce::String, int> fileIds;
+    size_t memoryBudget, bytesInUse = 0;
+    juce::int64 hits = 0, misses = 0, evictions = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DecodedAudioCache)
+};
+
+//==============================================================================
+/**
+    A positionable source that plays a file out of a DecodedAudioCache.
+
+    By default it only ever copies chunks that are already cached, and plays
+    silence for the ones that aren't, so it's safe to use on the audio thread;
+    something else (a CachePrefetcher, or a background reader created with
+    decodeOnMiss = true) has to fill the cache. With decodeOnMiss a missing
+    chunk is read from disk on the spot, which must never happen on the audio
+    thread.
+
+    If the file's layout is already known to the cache the file isn't even
+    opened; a reader is only created the first time a chunk has to be decoded.
+*/
+class CachingAudioSource   : public juce::PositionableAudioSource
+{
+public:
+    CachingAudioSource (DecodedAudioCache& c, juce::AudioFormatManager& fm, const juce::File& f,
+                        bool shouldDecodeOnMiss = false)
+        : cache (c), formatManager (fm), file (f), fileId (c.getFileId (f)), decodeOnMiss (shouldDecodeOnMiss)
+    {
+        if (! cache.getFileInfo (file, info) && openReader())
+        {
+            info.sampleRate = reader->sampleRate;
+            info.lengthInSamples = reader->lengthInSamples;
+            info.numChannels = (int) reader->numChannels;
+            cache.setFileInfo (file, info);
+        }
+    }
+
+    bool isValid() const noexcept               { return info.numChannels > 0 && info.sampleRate > 0; }
+    double getSampleRate() const noexcept       { return info.sampleRate; }
+    int getNumChannels() const noexcept         { return info.numChannels; }
+    const juce::File& getFile() const noexcept  { return file; }
+    int getFileId() const noexcept              { return fileId; }
+
+    /** Makes sure the chunk at the given index is in the cache, decoding it if
+        necessary. Returns nullptr if the chunk is past the end of the file or
+        couldn't be read.
+    */
+    DecodedAudioCache::Chunk fetchChunk (juce::int64 chunkIndex)
+    {
+        if (auto chunk = cache.getChunk (fileId, chunkIndex))
+            return chunk;
+
+        return decodeChunk (chunkIndex);
+    }
+
+    /** Reads a chunk from disk and stores it, without looking in the cache
+        first (so it doesn't count as a miss).
+    */
+    DecodedAudioCache::Chunk decodeChunk (juce::int64 chunkIndex)
+    {
+        auto start = chunkIndex * DecodedAudioCache::samplesPerChunk;
+        auto numSamples = (int) juce::jmin ((juce::int64) DecodedAudioCache::samplesPerChunk,
+                                            info.lengthInSamples - start);
+
+        if (numSamples <= 0 || (reader == nullptr && ! openReader()))
+            return {};
+
+        juce::AudioBuffer<float> data (info.numChannels, numSamples);
+
+        if (! reader->read (data.getArrayOfWritePointers(), info.numChannels, start, numSamples))
+            return {};
+
+        return cache.addChunk (fileId, chunkIndex, std::move (data));
+    }
+
+    //==========================================================================
+    void prepareToPlay (int, double) override {}
+    void releaseResources() override          { currentChunk.reset(); }
+
+    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        auto* buffer = bufferToFill.buffer;
+        auto numDone = 0;
+
+        while (numDone < bufferToFill.numSamples)
+        {
+            if (looping && info.lengthInSamples > 0)
+                nextReadPosition %= info.lengthInSamples;
+
+            auto chunkIndex = nextReadPosition / DecodedAudioCache::samplesPerChunk;
+            auto offsetInChunk = (int) (nextReadPosition % DecodedAudioCache::samplesPerChunk);
+
+            // the chunk being played is kept between blocks, so the cache is
+            // only consulted when crossing into the next one
+            if (currentChunk == nullptr || currentChunkIndex != chunkIndex)
+            {
+                currentChunk = nextReadPosition >= info.lengthInSamples ? nullptr
+                             : decodeOnMiss ? fetchChunk (chunkIndex)
+                                            : cache.getChunk (fileId, chunkIndex);
+                currentChunkIndex = chunkIndex;
+            }
+
+            auto chunk = currentChunk;
+
+            if (chunk == nullptr)
+            {
+                buffer->clear (bufferToFill.startSample + numDone, bufferToFill.numSamples - numDone);
+                nextReadPosition += bufferToFill.numSamples - numDone;
+                return;
+            }
+
+            auto num = juce::jmin (bufferToFill.numSamples - numDone, chunk->getNumSamples() - offsetInChunk);
+
+            // mono files are spread across every output channel, like
+            // AudioFormatReaderSource does
+            for (int ch = 0; ch < buffer->getNumChannels(); ++ch)
+                buffer->copyFrom (ch, bufferToFill.startSample + numDone,
+                                  *chunk, juce::jmin (ch, chunk->getNumChannels() - 1), offsetInChunk, num);
+
+            numDone += num;
+            nextReadPosition += num;
+        }
+    }
+
+    //==========================================================================
+    void setNextReadPosition (juce::int64 newPosition) override  { nextReadPosition = newPosition; }
+
+    juce::int64 getNextReadPosition() const override
+    {
+        return looping && info.lengthInSamples > 0 ? nextReadPosition % info.lengthInSamples
+                                                   : nextReadPosition;
+    }
+
+    juce::int64 getTotalLength() const override     { return info.lengthInSamples; }
+    bool isLooping() const override                 { return looping; }
+    void setLooping (bool shouldLoop) override      { looping = shouldLoop; }
+
+private:
+    bool openReader()
+    {
+        reader.reset (formatManager.createReaderFor (file));
+        return reader != nullptr;
+    }
+
+    DecodedAudioCache& cache;
+    juce::AudioFormatManager& formatManager;
+    juce::File file;
+    const int fileId;
+    const bool decodeOnMiss;
+    DecodedAudioCache::FileInfo info;
+    std::unique_ptr<juce::AudioFormatReader> reader;
+    DecodedAudioCache::Chunk currentChunk;
+    juce::int64 currentChunkIndex = -1;
+    juce::int64 nextReadPosition = 0;
+    bool looping = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CachingAudioSource)
+};
+
+//==============================================================================
+/**
+    Decodes the start of upcoming tracks into the cache on a background
+    thread, so that pressing Prev/Next doesn't have to wait for the disk.
+*/
+class CachePrefetcher   : private juce::TimeSliceClient
+{
+public:
+    CachePrefetcher (DecodedAudioCache& c, juce::AudioFormatManager& fm)
+        : cache (c), formatManager (fm)
+    {
+        thread.startThread (juce::Thread::Priority::low);
+        thread.addTimeSliceClient (this);
+    }
+
+    ~CachePrefetcher() override
+    {
+        thread.removeTimeSliceClient (this);
+        thread.stopThread (2000);
+    }
+
+    /** Replaces the list of files to prefetch. Only the first few seconds of
+        each one are decoded, so a large queue doesn't flush the whole cache.
+    */
+    void setFilesToPrefetch (const juce::Array<juce::File>& files, double secondsPerFile = 30.0)
+    {
+        const juce::ScopedLock sl (lock);
+        pending = files;
+        ++generation;
+        nextChunk = 0;
+        seconds = secondsPerFile;
+        thread.moveToFrontOfQueue (this);
+    }
+
+private:
+    // the lock only covers picking the next chunk; opening and decoding happen
+    // outside it, so setFilesToPrefetch() never waits for the disk
+    int useTimeSlice() override
+    {
+        juce::File file;
+        juce::int64 chunkIndex;
+        double secondsToDecode;
+        int generationAtStart;
+
+        {
+            const juce::ScopedLock sl (lock);
+
+            if (pending.isEmpty())
+                return 200;
+
+            file = pending.getReference (0);
+            chunkIndex = nextChunk++;
+            secondsToDecode = seconds;
+            generationAtStart = generation;
+        }
+
+        if (current == nullptr || current->getFile() != file)
+            current = std::make_unique<CachingAudioSource> (cache, formatManager, file, true);
+
+        auto maxChunks = (juce::int64) std::ceil (secondsToDecode * current->getSampleRate() / DecodedAudioCache::samplesPerChunk);
+        auto finished = ! current->isValid() || chunkIndex >= maxChunks
+                          || (! cache.containsChunk (current->getFileId(), chunkIndex)
+                               && current->decodeChunk (chunkIndex) == nullptr);
+
+        if (finished)
+        {
+            const juce::ScopedLock sl (lock);
+
+            if (generation == generationAtStart && ! pending.isEmpty())
+            {
+                pending.remove (0);
+                nextChunk = 0;
+            }
+        }
+
+        return 0;
+    }
+
+    DecodedAudioCache& cache;
+    juce::AudioFormatManager& formatManager;
+    juce::TimeSliceThread thread { "Audio Prefetch" };
+    juce::CriticalSection lock;
+    juce::Array<juce::File> pending;
+    juce::int64 nextChunk = 0;
+    double seconds = 30.0;
+    int generation = 0;
+    std::unique_ptr<CachingAudioSource> current;   // only touched by the prefetch thread
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CachePrefetcher)
+};
@@ -0,0 +1,404 @@
+/*
+  ==============================================================================
+
+    FeatureAnalyser.h
+
+    Headless, multithreaded feature extraction over a set of audio files, with
+    the results streamed out as CSV or JSON.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/**
+    Computes per-frame and per-file features for one file at a time.
+
+    Frames are the same size as the spectrogram's FFT and don't overlap, like
+    the spectrogram. The file is streamed through a small buffer, so memory use
+    doesn't depend on its length. Not thread-safe: use one per thread.
+*/
+class FeatureExtractor
+{
+public:
+    struct Settings
+    {
+        int fftOrder = 10;
+        double cutoff = 200.0, q = 0.1;     // the low-pass used for the energy ratio
+        float rolloffFraction = 0.85f;
+        int framesPerRead = 64;
+    };
+
+    struct FrameFeatures
+    {
+        double time = 0;
+        float rms = 0, peak = 0, centroid = 0, rolloff = 0, flatness = 0, filteredRatio = 0;
+    };
+
+    struct FileFeatures
+    {
+        juce::File file;
+        juce::String error;
+        double duration = 0;
+        juce::int64 numFrames = 0;
+        float rms = 0, peak = 0, centroid = 0, rolloff = 0, flatness = 0, filteredRatio = 0;
+    };
+
+    explicit FeatureExtractor (const Settings& s)
+        : settings (s),
+          fftSize (1 << s.fftOrder),
+          fft (s.fftOrder),
+          window ((size_t) fftSize, juce::dsp::WindowingFunction<float>::hann, false),
+          frame ((size_t) fftSize),
+          fftData ((size_t) fftSize * 2)
+    {
+    }
+
+    FileFeatures process (juce::AudioFormatReader& reader, const juce::File& file,
+                          const std::function<void (const FrameFeatures&)>& onFrame)
+    {
+        FileFeatures result;
+        result.file = file;
+        result.duration = reader.sampleRate > 0 ? (double) reader.lengthInSamples / reader.sampleRate : 0.0;
+
+        auto numChannels = (int) reader.numChannels;
+        auto blockSize = fftSize * settings.framesPerRead;
+        juce::AudioBuffer<float> block (numChannels, blockSize);
+
+        filter.coefficients = juce::dsp::IIR::Coefficients<float>::makeLowPass (reader.sampleRate, settings.cutoff, settings.q);
+        filter.reset();
+
+        double totalEnergy = 0, totalFilteredEnergy = 0, centroidSum = 0, rolloffSum = 0, flatnessSum = 0;
+
+        for (juce::int64 pos = 0; pos < reader.lengthInSamples; pos += blockSize)
+        {
+            auto numRead = (int) juce::jmin ((juce::int64) blockSize, reader.lengthInSamples - pos);
+
+            if (! reader.read (block.getArrayOfWritePointers(), numChannels, pos, numRead))
+            {
+                result.error = "Read failed";
+                return result;
+            }
+
+            for (int start = 0; start < numRead; start += fftSize)
+            {
+                auto frameLength = juce::jmin (fftSize, numRead - start);
+                auto features = analyseFrame (block, start, frameLength, reader.sampleRate);
+                features.time = (double) (pos + start) / reader.sampleRate;
+
+                totalEnergy += lastEnergy;
+                totalFilteredEnergy += lastFilteredEnergy;
+                centroidSum += features.centroid;
+                rolloffSum += features.rolloff;
+                flatnessSum += features.flatness;
+                result.peak = juce::jmax (result.peak, features.peak);
+                ++result.numFrames;
+
+                if (onFrame != nullptr)
+                    onFrame (features);
+            }
+        }
+
+        if (result.numFrames > 0)
+        {
+            auto n = (double) result.numFrames;
+            result.rms = (float) std::sqrt (totalEnergy / juce::jmax ((double) reader.lengthInSamples, 1.0));
+            result.centroid = (float) (centroidSum / n);
+            result.rolloff = (float) (rolloffSum / n);
+            result.flatness = (float) (flatnessSum / n);
+            result.filteredRatio = totalEnergy > 0 ? (float) (totalFilteredEnergy / totalEnergy) : 0.0f;
+        }
+
+        return result;
+    }
+
+private:
+    FrameFeatures analyseFrame (const juce::AudioBuffer<float>& block, int start, int length, double sampleRate)
+    {
+        FrameFeatures f;
+
+        // mono mixdown, zero-padding a short final frame
+        std::fill (frame.begin(), frame.end(), 0.0f);
+        auto gain = 1.0f / (float) block.getNumChannels();
+
+        for (int ch = 0; ch < block.getNumChannels(); ++ch)
+            juce::FloatVectorOperations::addWithMultiply (frame.data(), block.getReadPointer (ch, start), gain, length);
+
+        lastEnergy = 0;
+        lastFilteredEnergy = 0;
+
+        for (int i = 0; i < length; ++i)
+        {
+            auto x = (double) frame[(size_t) i];
+            auto y = (double) filter.processSample (frame[(size_t) i]);
+            lastEnergy += x * x;
+            lastFilteredEnergy += y * y;
+        }
+
+        auto range = juce::FloatVectorOperations::findMinAndMax (frame.data(), length);
+        f.peak = juce::jmax (std::abs (range.getStart()), std::abs (range.getEnd()));
+        f.rms = (float) std::sqrt (lastEnergy / length);
+        f.filteredRatio = lastEnergy > 0 ? (float) (lastFilteredEnergy / lastEnergy) : 0.0f;
+
+        std::copy (frame.begin(), frame.end(), fftData.begin());
+        std::fill (fftData.begin() + fftSize, fftData.end(), 0.0f);
+        window.multiplyWithWindowingTable (fftData.data(), (size_t) fftSize);
+        fft.performFrequencyOnlyForwardTransform (fftData.data());
+
+        auto numBins = fftSize / 2;
+        auto binWidth = sampleRate / fftSize;
+        double magSum = 0, weightedSum = 0, powerSum = 0, logPowerSum = 0;
+
+        for (int k = 0; k < numBins; ++k)
+        {
+            auto mag = (double) fftData[(size_t) k];
+            auto power = mag * mag;
+            magSum += mag;
+            weightedSum += mag * k * binWidth;
+            powerSum += power;
+            logPowerSum += std::log (power + 1e-12);
+        }
+
+        if (magSum > 0)
+            f.centroid = (float) (weightedSum / magSum);
+
+        if (powerSum > 0)
+        {
+            auto threshold = powerSum * settings.rolloffFraction;
+            double cumulative = 0;
+
+            for (int k = 0; k < numBins; ++k)
+            {
+                cumulative += (double) fftData[(size_t) k] * fftData[(size_t) k];
+
+                if (cumulative >= threshold)
+                {
+                    f.rolloff = (float) (k * binWidth);
+                    break;
+                }
+            }
+
+            f.flatness = (float) (std::exp (logPowerSum / numBins) / (powerSum / numBins));
+        }
+
+        return f;
+    }
+
+    Settings settings;
+    int fftSize;
+    juce::dsp::FFT fft;
+    juce::dsp::WindowingFunction<float> window;
+    juce::dsp::IIR::Filter<float> filter;
+    std::vector<float> frame, fftData;
+    double lastEnergy = 0, lastFilteredEnergy = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FeatureExtractor)
+};
+
+//==============================================================================
+/**
+    Runs a FeatureExtractor over a list of files on a thread pool, one job per
+    file.
+
+    Each job streams its frames into its own file in the output directory, so
+    the workers never contend on a shared writer; only the small per-file
+    summaries are collected and written out at the end.
+*/
+class LibraryAnalyser
+{
+public:
+    enum class Format { csv, json };
+
+    LibraryAnalyser (juce::AudioFormatManager& fm, const FeatureExtractor::Settings& s,
+                     int numThreads = juce::SystemStats::getNumCpus())
+        : formatManager (fm), settings (s), pool (juce::jmax (1, numThreads))
+    {
+    }
+
+    /** Expands directories (recursively) and .m3u playlists into the audio
+        files they contain that formatManager can read.
+    */
+    static juce::Array<juce::File> findAudioFiles (juce::AudioFormatManager& formatManager,
+                                                   const juce::StringArray& paths)
+    {
+        juce::Array<juce::File> result;
+
+        auto addIfReadable = [&] (const juce::File& f)
+        {
+            if (f.existsAsFile() && formatManager.findFormatForFileExtension (f.getFileExtension()) != nullptr)
+                result.addIfNotAlreadyThere (f);
+        };
+
+        for (auto& path : paths)
+        {
+            auto f = juce::File::getCurrentWorkingDirectory().getChildFile (path);
+
+            if (f.isDirectory())
+            {
+                for (const auto& entry : juce::RangedDirectoryIterator (f, true, formatManager.getWildcardForAllFormats()))
+                    addIfReadable (entry.getFile());
+            }
+            else if (f.hasFileExtension ("m3u;m3u8"))
+            {
+                juce::StringArray lines;
+                f.readLines (lines);
+
+                for (auto& line : lines)
+                    if (line.trim().isNotEmpty() && ! line.startsWith ("#"))
+                        addIfReadable (f.getParentDirectory().getChildFile (line.trim()));
+            }
+            else
+            {
+                addIfReadable (f);
+            }
+        }
+
+        return result;
+    }
+
+    /** Analyses every file and blocks until they're all done. Returns false if
+        the output couldn't be written; files that fail to read are reported in
+        the summary instead.
+    */
+    bool run (const juce::Array<juce::File>& files, const juce::File& outputDirectory, Format format)
+    {
+        if (! outputDirectory.createDirectory())
+            return false;
+
+        results.clear();
+        results.resize ((size_t) files.size());
+
+        for (int i = 0; i < files.size(); ++i)
+        {
+            auto name = juce::String (i).paddedLeft ('0', 4) + "_" + files[i].getFileNameWithoutExtension()
+                          + ".frames" + (format == Format::json ? ".json" : ".csv");
+
+            pool.addJob (new AnalysisJob (*this, files[i], outputDirectory.getChildFile (name), format, (size_t) i), true);
+        }
+
+        while (pool.getNumJobs() > 0)
+            juce::Thread::sleep (10);
+
+        return writeSummary (outputDirectory.getChildFile (format == Format::json ? "summary.json" : "summary.csv"), format);
+    }
+
+    const std::vector<FeatureExtractor::FileFeatures>& getResults() const noexcept   { return results; }
+
+private:
+    class AnalysisJob   : public juce::ThreadPoolJob
+    {
+    public:
+        AnalysisJob (LibraryAnalyser& o, const juce::File& in, const juce::File& out, Format fmt, size_t index)
+            : juce::ThreadPoolJob ("Analyse " + in.getFileName()),
+              owner (o), input (in), output (out), format (fmt), resultIndex (index)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            auto& result = owner.results[resultIndex];
+            result.file = input;
+
+            std::unique_ptr<juce::AudioFormatReader> reader (owner.formatManager.createReaderFor (input));
+
+            if (reader == nullptr)
+            {
+                result.error = "Unreadable file";
+                return jobHasFinished;
+            }
+
+            output.deleteFile();
+            juce::FileOutputStream out (output);
+
+            if (! out.openedOk())
+            {
+                result.error = "Couldn't write " + output.getFileName();
+                return jobHasFinished;
+            }
+
+            auto first = true;
+            out << (format == Format::json ? "[\n" : "time,rms,peak,centroid_hz,rolloff_hz,flatness,filtered_ratio\n");
+
+            FeatureExtractor extractor (owner.settings);
+            result = extractor.process (*reader, input, [&] (const FeatureExtractor::FrameFeatures& f)
+            {
+                if (format == Format::json)
+                {
+                    out << (first ? "  " : ",\n  ") << "{\"time\":" << juce::String (f.time, 4)
+                        << ",\"rms\":" << f.rms << ",\"peak\":" << f.peak
+                        << ",\"centroid_hz\":" << f.centroid << ",\"rolloff_hz\":" << f.rolloff
+                        << ",\"flatness\":" << f.flatness << ",\"filtered_ratio\":" << f.filteredRatio << "}";
+                }
+                else
+                {
+                    out << juce::String (f.time, 4) << "," << f.rms << "," << f.peak << "," << f.centroid << ","
+                        << f.rolloff << "," << f.flatness << "," << f.filteredRatio << "\n";
+                }
+
+                first = false;
+            });
+
+            if (format == Format::json)
+                out << "\n]\n";
+
+            return jobHasFinished;
+        }
+
+    private:
+        LibraryAnalyser& owner;
+        juce::File input, output;
+        Format format;
+        size_t resultIndex;
+    };
+
+    bool writeSummary (const juce::File& file, Format format) const
+    {
+        if (format == Format::json)
+        {
+            juce::Array<juce::var> rows;
+
+            for (auto& r : results)
+            {
+                auto* obj = new juce::DynamicObject();
+                obj->setProperty ("file", r.file.getFullPathName());
+
+                if (r.error.isNotEmpty())
+                {
+                    obj->setProperty ("error", r.error);
+                }
+                else
+                {
+                    obj->setProperty ("duration", r.duration);
+                    obj->setProperty ("frames", r.numFrames);
+                    obj->setProperty ("rms", r.rms);
+                    obj->setProperty ("peak", r.peak);
+                    obj->setProperty ("centroid_hz", r.centroid);
+                    obj->setProperty ("rolloff_hz", r.rolloff);
+                    obj->setProperty ("flatness", r.flatness);
+                    obj->setProperty ("filtered_ratio", r.filteredRatio);
+                }
+
+                rows.add (juce::var (obj));
+            }
+
+            return file.replaceWithText (juce::JSON::toString (rows));
+        }
+
+        juce::String csv ("file,duration,frames,rms,peak,centroid_hz,rolloff_hz,flatness,filtered_ratio,error\n");
+
+        for (auto& r : results)
+            csv << r.file.getFullPathName().quoted() << "," << r.duration << "," << r.numFrames << ","
+                << r.rms << "," << r.peak << "," << r.centroid << "," << r.rolloff << ","
+                << r.flatness << "," << r.filteredRatio << "," << r.error.quoted() << "\n";
+
+        return file.replaceWithText (csv);
+    }
+
+    juce::AudioFormatManager& formatManager;
+    FeatureExtractor::Settings settings;
+    juce::ThreadPool pool;
+    std::vector<FeatureExtractor::FileFeatures> results;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LibraryAnalyser)
+};
@@ -0,0 +1,161 @@
+/*
+  ==============================================================================
+
+    FilterResponseOverlay.h
+
+    Draws the frequency response of the filter on top of the spectrogram.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/**
+    A transparent component showing the magnitude (and optionally phase)
+    response of a set of IIR coefficients.
+
+    Frequency runs bottom to top on the same skewed, roughly logarithmic scale
+    as the spectrogram, so the curve lines up with the bins underneath it;
+    gain runs left to right.
+
+    The response is evaluated in one batch over a precomputed frequency grid,
+    and only when the coefficients, sample rate or size actually change. The
+    resulting paths are kept, and the component is buffered to an image, so
+    redrawing the spectrogram underneath doesn't cost anything extra.
+*/
+class FilterResponseOverlay   : public juce::Component
+{
+public:
+    using Coefficients = juce::dsp::IIR::Coefficients<float>;
+
+    /** Maps a vertical position (0 at the top, 1 at the bottom) to a fraction
+        of the Nyquist frequency, as used to draw the spectrogram.
+    */
+    static float getSkewedProportionY (float proportionY) noexcept
+    {
+        return 1.0f - std::exp (std::log (proportionY) * 0.2f);
+    }
+
+    FilterResponseOverlay()
+    {
+        setInterceptsMouseClicks (false, false);
+        setBufferedToImage (true);
+    }
+
+    void setCoefficients (Coefficients::Ptr newCoefficients, double newSampleRate)
+    {
+        if (newCoefficients == nullptr)
+            return;
+
+        if (coefficients != nullptr && sampleRate == newSampleRate
+             && coefficients->coefficients == newCoefficients->coefficients)
+            return;
+
+        coefficients = newCoefficients;
+
+        if (sampleRate != newSampleRate)
+        {
+            sampleRate = newSampleRate;
+            updateFrequencyGrid();
+        }
+
+        updateResponse();
+    }
+
+    void setShowPhase (bool shouldShowPhase)
+    {
+        if (showPhase != shouldShowPhase)
+        {
+            showPhase = shouldShowPhase;
+            updateResponse();
+        }
+    }
+
+    //==========================================================================
+    void paint (juce::Graphics& g) override
+    {
+        if (showPhase)
+        {
+            g.setColour (juce::Colours::orange.withAlpha (0.5f));
+            g.strokePath (phasePath, juce::PathStrokeType (1.0f));
+        }
+
+        g.setColour (juce::Colours::white.withAlpha (0.8f));
+        g.strokePath (magnitudePath, juce::PathStrokeType (1.5f));
+    }
+
+    void resized() override
+    {
+        updateFrequencyGrid();
+        updateResponse();
+    }
+
+private:
+    // one point per pixel row, skipping the top row just like the spectrogram
+    void updateFrequencyGrid()
+    {
+        auto numPoints = (size_t) juce::jmax (2, getHeight() - 1);
+
+        frequencies.resize (numPoints);
+        magnitudes.resize (numPoints);
+        phases.resize (numPoints);
+
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            auto proportionY = (float) (i + 1) / (float) (numPoints + 1);
+            frequencies[i] = juce::jmax (1.0, getSkewedProportionY (proportionY) * sampleRate * 0.5);
+        }
+    }
+
+    void updateResponse()
+    {
+        magnitudePath.clear();
+        phasePath.clear();
+
+        if (coefficients == nullptr || frequencies.empty() || sampleRate <= 0)
+            return;
+
+        auto numPoints = frequencies.size();
+        coefficients->getMagnitudeForFrequencyArray (frequencies.data(), magnitudes.data(), numPoints, sampleRate);
+
+        if (showPhase)
+            coefficients->getPhaseForFrequencyArray (frequencies.data(), phases.data(), numPoints, sampleRate);
+
+        auto bounds = getLocalBounds().toFloat();
+        auto yStep = bounds.getHeight() / (float) (numPoints + 1);
+
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            auto y = bounds.getY() + yStep * (float) (i + 1);
+            auto db = (float) juce::Decibels::gainToDecibels (magnitudes[i], (double) minDecibels);
+            auto x = juce::jmap (juce::jlimit (minDecibels, maxDecibels, db),
+                                 minDecibels, maxDecibels, bounds.getX(), bounds.getRight());
+
+            if (i == 0)  magnitudePath.startNewSubPath (x, y);
+            else         magnitudePath.lineTo (x, y);
+
+            if (showPhase)
+            {
+                auto px = juce::jmap ((float) phases[i], -juce::MathConstants<float>::pi,
+                                      juce::MathConstants<float>::pi, bounds.getX(), bounds.getRight());
+
+                if (i == 0)  phasePath.startNewSubPath (px, y);
+                else         phasePath.lineTo (px, y);
+            }
+        }
+
+        repaint();
+    }
+
+    static constexpr float minDecibels = -36.0f, maxDecibels = 18.0f;
+
+    Coefficients::Ptr coefficients;
+    double sampleRate = 44100.0;
+    bool showPhase = false;
+
+    std::vector<double> frequencies, magnitudes, phases;
+    juce::Path magnitudePath, phasePath;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FilterResponseOverlay)
+};
@@ -8,6 +8,8 @@
 
 #include <JuceHeader.h>
 #include "PlayingSoundFilesTutorial_01.h"
+#include "FeatureAnalyser.h"
+#include "MultiTrackMixer.h"
 
 class Application    : public juce::JUCEApplication
 {
@@ -20,12 +22,176 @@ public:
 
     void initialise (const juce::String&) override
     {
-        mainWindow.reset (new MainWindow ("Fratm", new MainContentComponent, *this));
+        juce::ArgumentList args (getApplicationName(), getCommandLineParameterArray());
+
+        if (args.containsOption ("--analyse"))
+        {
+            setApplicationReturnValue (runAnalysis (args));
+            quit();
+            return;
+        }
+
+        if (args.containsOption ("--benchmark-voices"))
+        {
+            setApplicationReturnValue (runVoiceBenchmark (args));
+            quit();
+            return;
+        }
+
+        // GUI mode: [--cache-mb <MB>] sets the decoded-audio cache's budget
+        auto* content = new MainContentComponent();
+        auto cacheMegabytes = getOptionValue (args, "--cache-mb").getIntValue();
+
+        if (cacheMegabytes > 0)
+            content->setCacheMemoryBudget ((size_t) cacheMegabytes * 1024 * 1024);
+
+        mainWindow.reset (new MainWindow ("Fratm", content, *this));
     }
 
     void shutdown() override                         { mainWindow = nullptr; }
 
 private:
+    //==============================================================================
+    // The options that take a value, given either as "--option value" or
+    // "--option=value"
+    static const juce::StringArray& getOptionsWithValues()
+    {
+        static const juce::StringArray options { "--out", "--format", "--cutoff", "--q", "--threads",
+                                                 "--buffer-size", "--sample-rate", "--cache-mb" };
+        return options;
+    }
+
+    // ArgumentList::getValueForOption() only understands "--option=value" for
+    // long options, so the space-separated form is looked up here
+    static juce::String getOptionValue (const juce::ArgumentList& args, juce::StringRef option,
+                                        const juce::String& defaultValue = {})
+    {
+        auto index = args.indexOfOption (option);
+
+        if (index < 0)
+            return defaultValue;
+
+        auto& text = args.arguments.getReference (index).text;
+
+        if (text.contains ("="))
+            return text.fromFirstOccurrenceOf ("=", false, false);
+
+        if (index + 1 < args.arguments.size() && ! args.arguments.getReference (index + 1).text.startsWith ("--"))
+            return args.arguments.getReference (index + 1).text;
+
+        return defaultValue;
+    }
+
+    // everything that's neither an option nor the value of one
+    static juce::StringArray getPositionalArguments (const juce::ArgumentList& args)
+    {
+        juce::StringArray result;
+
+        for (int i = 0; i < args.arguments.size(); ++i)
+        {
+            auto& text = args.arguments.getReference (i).text;
+
+            if (text.startsWith ("--"))
+            {
+                if (getOptionsWithValues().contains (text))
+                    ++i;
+            }
+            else
+            {
+                result.add (text);
+            }
+        }
+
+        return result;
+    }
+
+    //==============================================================================
+    // Headless mode:
+    //   --analyse <files, directories or .m3u playlists..> --out <dir>
+    //   [--format csv|json] [--cutoff <Hz>] [--q <Q>] [--threads <n>]
+    int runAnalysis (const juce::ArgumentList& args)
+    {
+        auto paths = getPositionalArguments (args);
+
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        auto files = LibraryAnalyser::findAudioFiles (formatManager, paths);
+
+        if (files.isEmpty())
+        {
+            std::cerr << "No readable audio files found" << std::endl;
+            return 1;
+        }
+
+        FeatureExtractor::Settings settings;
+        settings.fftOrder = MainContentComponent::fftOrder;
+
+        settings.cutoff = getOptionValue (args, "--cutoff", juce::String (settings.cutoff)).getDoubleValue();
+        settings.q = getOptionValue (args, "--q", juce::String (settings.q)).getDoubleValue();
+
+        if (settings.cutoff <= 0 || settings.q <= 0)
+        {
+            std::cerr << "--cutoff and --q must be positive numbers" << std::endl;
+            return 1;
+        }
+
+        auto numThreads = juce::jmax (1, getOptionValue (args, "--threads", juce::String (juce::SystemStats::getNumCpus())).getIntValue());
+        auto format = getOptionValue (args, "--format") == "json" ? LibraryAnalyser::Format::json
+                                                                  : LibraryAnalyser::Format::csv;
+        auto outputDir = juce::File::getCurrentWorkingDirectory().getChildFile (getOptionValue (args, "--out", "analysis"));
+
+        LibraryAnalyser analyser (formatManager, settings, numThreads);
+        auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+        if (! analyser.run (files, outputDir, format))
+        {
+            std::cerr << "Couldn't write to " << outputDir.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        std::cout << "Analysed " << files.size() << " files on " << numThreads << " threads in "
+                  << (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0 << " s -> "
+                  << outputDir.getFullPathName() << std::endl;
+        return 0;
+    }
+
+    //==============================================================================
+    // Headless mode:
+    //   --benchmark-voices [--buffer-size <samples>] [--sample-rate <Hz>] [--threads <n>]
+    int runVoiceBenchmark (const juce::ArgumentList& args)
+    {
+        auto blockSize = getOptionValue (args, "--buffer-size", "512").getIntValue();
+        auto sampleRate = getOptionValue (args, "--sample-rate", "44100").getDoubleValue();
+        auto numThreads = juce::jmax (1, getOptionValue (args, "--threads", juce::String (juce::SystemStats::getNumCpus())).getIntValue());
+
+        if (blockSize <= 0 || sampleRate <= 0)
+        {
+            std::cerr << "Invalid buffer size or sample rate" << std::endl;
+            return 1;
+        }
+
+        std::cout << "Buffer size " << blockSize << " @ " << sampleRate << " Hz" << std::endl;
+
+        for (auto threads : { 1, numThreads })
+        {
+            auto result = MixerStressBenchmark::run (blockSize, sampleRate, threads - 1);
+
+            std::cout << "  " << result.numThreads << " thread(s), " << result.numRealtimeWorkers
+                      << " realtime worker(s): " << result.maxVoices << " voices, "
+                      << result.voicesPerCore << " per core" << std::endl;
+
+            if (result.numThreads < threads)
+                std::cout << "  (only " << result.numThreads - 1 << " of " << threads - 1
+                          << " worker threads could be started)" << std::endl;
+
+            if (numThreads == 1)
+                break;
+        }
+
+        return 0;
+    }
+
     class MainWindow    : public juce::DocumentWindow
     {
     public:
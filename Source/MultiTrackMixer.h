@@ -0,0 +1,645 @@
+/*
+  ==============================================================================
+
+    MultiTrackMixer.h
+
+    Plays several tracks at once, each through its own filter, and spreads the
+    voices across a small pool of realtime worker threads when there are many
+    of them.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <thread>
+
+//==============================================================================
+/**
+    A fixed set of realtime worker threads that the audio callback can hand a
+    batch of independent tasks to.
+
+    Tasks are claimed from a single atomic word tagged with the batch number,
+    so a worker that wakes up late can never pick up work from a batch that's
+    already over. The calling thread claims tasks as well, which means every
+    task that no worker got to in time is simply run by the caller itself.
+    After that it only spins for tasks that are already running on a worker,
+    and only until a deadline: run() then returns false and leaves those
+    tasks to finish in the background.
+
+    Nothing is allocated or locked per batch apart from waking the workers.
+*/
+class RealtimeWorkerPool
+{
+public:
+    using Task = void (*) (void* context, int taskIndex);
+
+    explicit RealtimeWorkerPool (int numWorkers)
+    {
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            auto worker = std::make_unique<Worker> (*this, i);
+
+            // realtime scheduling needs permission (rtprio on Linux), so fall
+            // back to an ordinary high priority; a worker that can't start at
+            // all isn't counted
+            if (worker->startRealtimeThread (juce::Thread::RealtimeOptions{}))
+                ++numRealtimeWorkers;
+            else if (! worker->startThread (juce::Thread::Priority::highest))
+                continue;
+
+            workers.add (worker.release());
+        }
+    }
+
+    ~RealtimeWorkerPool()
+    {
+        for (auto* w : workers)
+            w->signalThreadShouldExit();
+
+        for (auto* w : workers)
+        {
+            w->wake.signal();
+            w->stopThread (1000);
+        }
+    }
+
+    /** The number of workers that actually started, and how many of those
+        got realtime scheduling.
+    */
+    int getNumWorkers() const noexcept             { return workers.size(); }
+    int getNumRealtimeWorkers() const noexcept     { return numRealtimeWorkers; }
+
+    /** True when no worker is inside a task, including stragglers from a batch
+        that run() gave up waiting for.
+    */
+    bool isIdle() const noexcept           { return numBusyWorkers.load() == 0; }
+
+    /** Calls task (context, i) for every i in [0, numTasks), on the workers and
+        the calling thread. Returns true once all of them are done, or false if
+        some were still running on a worker after maxWaitMs.
+    */
+    bool run (int numTasks, Task task, void* context, double maxWaitMs) noexcept
+    {
+        jassert (numTasks > 0 && numTasks < 0xffff);
+
+        auto batch = ++batchNumber;
+        currentTask = task;
+        currentContext = context;
+        completed.store (pack (batch, 0), std::memory_order_relaxed);
+        claims.store (pack (batch, (juce::uint32) numTasks << 16), std::memory_order_release);
+
+        for (int i = 0; i < juce::jmin (workers.size(), numTasks - 1); ++i)
+            workers.getUnchecked (i)->wake.signal();
+
+        runTasks();
+
+        auto deadline = juce::Time::getHighResolutionTicks()
+                          + juce::Time::secondsToHighResolutionTicks (maxWaitMs / 1000.0);
+
+        while (completed.load (std::memory_order_acquire) != pack (batch, (juce::uint32) numTasks))
+        {
+            if (juce::Time::getHighResolutionTicks() > deadline)
+                return false;
+
+            std::this_thread::yield();
+        }
+
+        return true;
+    }
+
+private:
+    struct Worker   : public juce::Thread
+    {
+        Worker (RealtimeWorkerPool& p, int index)
+            : juce::Thread ("Mixer Worker " + juce::String (index)), pool (p)
+        {
+        }
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                wake.wait (-1);
+
+                if (threadShouldExit())
+                    break;
+
+                ++pool.numBusyWorkers;
+                pool.runTasks();
+                --pool.numBusyWorkers;
+            }
+        }
+
+        RealtimeWorkerPool& pool;
+        juce::WaitableEvent wake;
+    };
+
+    // high 32 bits: batch number; low 32 bits: (task count << 16) | next task
+    // for claims, or the number of finished tasks for completed
+    static juce::uint64 pack (juce::uint32 batch, juce::uint32 value) noexcept
+    {
+        return ((juce::uint64) batch << 32) | value;
+    }
+
+    void runTasks() noexcept
+    {
+        for (;;)
+        {
+            auto claim = claims.load (std::memory_order_acquire);
+            auto next = (int) (claim & 0xffff);
+
+            if (next >= (int) ((claim >> 16) & 0xffff))
+                return;
+
+            // read before claiming: if the claim succeeds the batch can't have
+            // moved on, so these still belong to it
+            auto task = currentTask;
+            auto context = currentContext;
+
+            if (! claims.compare_exchange_weak (claim, claim + 1, std::memory_order_acq_rel))
+                continue;
+
+            task (context, next);
+
+            auto batch = (juce::uint32) (claim >> 32);
+            auto done = completed.load (std::memory_order_relaxed);
+
+            while ((juce::uint32) (done >> 32) == batch
+                    && ! completed.compare_exchange_weak (done, done + 1, std::memory_order_acq_rel))
+            {}
+        }
+    }
+
+    juce::OwnedArray<Worker> workers;
+    int numRealtimeWorkers = 0;
+    std::atomic<Task> currentTask { nullptr };
+    std::atomic<void*> currentContext { nullptr };
+    juce::uint32 batchNumber = 0;
+    std::atomic<juce::uint64> claims { 0 }, completed { 0 };
+    std::atomic<int> numBusyWorkers { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeWorkerPool)
+};
+
+//==============================================================================
+/**
+    One track in the mix: its own source, resampler, low-pass filter state,
+    gain and position.
+*/
+class MixerVoice
+{
+public:
+    MixerVoice (std::unique_ptr<juce::PositionableAudioSource> sourceToUse, double sourceRate, int numChannels)
+        : source (std::move (sourceToUse)),
+          sourceSampleRate (sourceRate),
+          resampler (source.get(), false, numChannels),
+          filter (juce::dsp::IIR::Coefficients<float>::makeLowPass (44100, 20000.0f, 0.1f))
+    {
+    }
+
+    void prepare (int maxBlockSize, double sampleRate, int numChannels)
+    {
+        deviceSampleRate = sampleRate;
+        resampler.setResamplingRatio (sourceSampleRate / sampleRate);
+        resampler.prepareToPlay (maxBlockSize, sampleRate);
+        buffer.setSize (numChannels, maxBlockSize);
+
+        juce::dsp::ProcessSpec spec { sampleRate, (juce::uint32) maxBlockSize, (juce::uint32) numChannels };
+        filter.prepare (spec);
+        filter.reset();
+        setFilter (cutoff, q);
+    }
+
+    void release()
+    {
+        resampler.releaseResources();
+    }
+
+    using BiquadCoefficients = std::array<float, 5>;   // normalised b0 b1 b2 a1 a2
+
+    static BiquadCoefficients makeLowPass (double sampleRate, float cutoff, float q)
+    {
+        auto c = juce::dsp::IIR::Coefficients<float>::makeLowPass (sampleRate, cutoff, q);
+        jassert (c->coefficients.size() == 5);
+
+        BiquadCoefficients result;
+        std::copy (c->coefficients.begin(), c->coefficients.end(), result.begin());
+        return result;
+    }
+
+    /** Computes new low-pass coefficients for this voice. This allocates, so
+        it mustn't be called on the audio thread.
+    */
+    void setFilter (float newCutoff, float newQ)
+    {
+        cutoff = newCutoff;
+        q = newQ;
+        setCoefficients (makeLowPass (deviceSampleRate, cutoff, q));
+    }
+
+    /** Can be called from any thread; the new coefficients are picked up at
+        the start of the next block without allocating.
+    */
+    void setCoefficients (const BiquadCoefficients& newCoefficients) noexcept
+    {
+        const juce::SpinLock::ScopedLockType sl (coefficientLock);
+        pendingCoefficients = newCoefficients;
+        hasPendingCoefficients = true;
+    }
+
+    juce::PositionableAudioSource* getSource() const noexcept   { return source.get(); }
+
+    void setGain (float newGain) noexcept                { gain = newGain; }
+    float getGain() const noexcept                       { return gain; }
+
+    /** Seeks at the start of the next block this voice renders, where the
+        resampler and filter can be flushed as well, so nothing buffered from
+        the old position is played after the jump.
+    */
+    void setPosition (double seconds)                    { pendingPosition = juce::jmax ((juce::int64) 0, (juce::int64) (seconds * sourceSampleRate)); }
+    double getPosition() const                           { return (double) getReadPosition() / sourceSampleRate; }
+
+    bool hasFinished() const
+    {
+        return ! source->isLooping() && getReadPosition() >= source->getTotalLength();
+    }
+
+    /** Renders the given block unless another thread is still busy with this
+        voice, and marks the buffer as belonging to that block. Safe to call for
+        different voices on different threads at the same time.
+    */
+    void renderBlock (juce::uint32 blockNumber, int numSamples)
+    {
+        if (busy.exchange (true, std::memory_order_acquire))
+            return;
+
+        render (numSamples);
+        renderedBlock.store (blockNumber, std::memory_order_release);
+        busy.store (false, std::memory_order_release);
+    }
+
+    bool hasRendered (juce::uint32 blockNumber) const noexcept
+    {
+        return renderedBlock.load (std::memory_order_acquire) == blockNumber;
+    }
+
+    bool isBusy() const noexcept      { return busy.load(); }
+
+    const juce::AudioBuffer<float>& getBuffer() const noexcept   { return buffer; }
+
+private:
+    juce::int64 getReadPosition() const
+    {
+        auto pending = pendingPosition.load();
+        return pending >= 0 ? pending : source->getNextReadPosition();
+    }
+
+    void render (int numSamples)
+    {
+        auto newPosition = pendingPosition.exchange (-1);
+
+        if (newPosition >= 0)
+        {
+            source->setNextReadPosition (newPosition);
+            resampler.flushBuffers();
+            filter.reset();
+        }
+
+        {
+            const juce::SpinLock::ScopedTryLockType sl (coefficientLock);
+
+            if (sl.isLocked() && hasPendingCoefficients)
+            {
+                std::copy (pendingCoefficients.begin(), pendingCoefficients.end(), filter.state->getRawCoefficients());
+                hasPendingCoefficients = false;
+            }
+        }
+
+        resampler.getNextAudioBlock ({ &buffer, 0, numSamples });
+
+        auto block = juce::dsp::AudioBlock<float> (buffer).getSubBlock (0, (size_t) numSamples);
+        filter.process (juce::dsp::ProcessContextReplacing<float> (block));
+    }
+
+    std::unique_ptr<juce::PositionableAudioSource> source;
+    double sourceSampleRate, deviceSampleRate = 44100.0;
+    juce::ResamplingAudioSource resampler;
+    juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>> filter;
+    juce::AudioBuffer<float> buffer;
+
+    juce::SpinLock coefficientLock;
+    BiquadCoefficients pendingCoefficients {};
+    bool hasPendingCoefficients = false;
+    float cutoff = 20000.0f, q = 0.1f;
+    std::atomic<float> gain { 1.0f };
+    std::atomic<bool> busy { false };
+    std::atomic<juce::int64> pendingPosition { -1 };
+    std::atomic<juce::uint32> renderedBlock { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MixerVoice)
+};
+
+//==============================================================================
+/**
+    Mixes any number of MixerVoices.
+
+    Each voice renders into its own buffer, either on the audio thread or, once
+    there are at least getParallelThreshold() voices, across a
+    RealtimeWorkerPool. The buffers are then summed one output channel at a
+    time, so the output channel stays in cache while every voice is added in.
+*/
+class MultiTrackMixer   : public juce::AudioSource
+{
+public:
+    explicit MultiTrackMixer (int numOutputChannels = 2,
+                              int numWorkerThreads = juce::SystemStats::getNumCpus() - 1,
+                              int voicesBeforeGoingParallel = 4)
+        : numChannels (numOutputChannels),
+          parallelThreshold (voicesBeforeGoingParallel),
+          workers (juce::jmax (0, numWorkerThreads))
+    {
+    }
+
+    ~MultiTrackMixer() override
+    {
+        removeAllVoices();
+    }
+
+    //==========================================================================
+    // The voice list is only changed and inspected on the message thread. The
+    // lock just keeps the audio callback out while it's being changed: the
+    // callback only ever tries to take it, and plays silence if it can't.
+
+    /** Adds a voice, preparing it first if the mixer is already running. */
+    MixerVoice* addVoice (std::unique_ptr<juce::PositionableAudioSource> source, double sourceSampleRate)
+    {
+        auto voice = std::make_unique<MixerVoice> (std::move (source), sourceSampleRate, numChannels);
+        voice->setFilter (cutoff, q);
+
+        // prepared outside the lock, and only again inside it in the rare
+        // case that the device was restarted in between
+        auto preparedBlockSize = blockSize.load();
+        auto preparedSampleRate = sampleRate.load();
+
+        if (preparedBlockSize > 0)
+            voice->prepare (preparedBlockSize, preparedSampleRate, numChannels);
+
+        const juce::ScopedLock sl (lock);
+        waitForStragglers();
+
+        if (blockSize > 0 && (blockSize != preparedBlockSize || sampleRate != preparedSampleRate))
+            voice->prepare (blockSize, sampleRate, numChannels);
+
+        return voices.add (voice.release());
+    }
+
+    void removeAllVoices()
+    {
+        juce::OwnedArray<MixerVoice> oldVoices;
+
+        {
+            const juce::ScopedLock sl (lock);
+            waitForStragglers();
+            oldVoices.swapWith (voices);
+        }
+    }
+
+    int getNumVoices() const                 { return voices.size(); }
+    MixerVoice* getVoice (int index) const   { return voices[index]; }
+
+    void setFilterForAllVoices (float newCutoff, float newQ)
+    {
+        cutoff = newCutoff;
+        q = newQ;
+
+        // computed once; each voice then only swaps in five floats under its
+        // own spin lock, which the callback never waits on
+        auto coefficients = MixerVoice::makeLowPass (sampleRate, cutoff, q);
+
+        for (auto* v : voices)
+            v->setCoefficients (coefficients);
+    }
+
+    /** The mixer only pulls its voices while playing, and outputs silence
+        otherwise; it starts out stopped.
+    */
+    void setPlaying (bool shouldPlay) noexcept             { playing = shouldPlay; }
+    bool isPlaying() const noexcept                        { return playing.load(); }
+
+    void setPositionForAllVoices (double seconds)
+    {
+        for (auto* v : voices)
+            v->setPosition (seconds);
+    }
+
+    /** True once there's at least one voice and none of them has anything left to play. */
+    bool haveAllVoicesFinished() const
+    {
+        if (voices.isEmpty())
+            return false;
+
+        for (auto* v : voices)
+            if (! v->hasFinished())
+                return false;
+
+        return true;
+    }
+
+    void setParallelThreshold (int numVoices) noexcept     { parallelThreshold = numVoices; }
+    int getParallelThreshold() const noexcept              { return parallelThreshold; }
+    int getNumWorkerThreads() const noexcept               { return workers.getNumWorkers(); }
+    int getNumRealtimeWorkerThreads() const noexcept       { return workers.getNumRealtimeWorkers(); }
+
+    //==========================================================================
+    void prepareToPlay (int samplesPerBlockExpected, double newSampleRate) override
+    {
+        const juce::ScopedLock sl (lock);
+        waitForStragglers();
+        blockSize = samplesPerBlockExpected;
+        sampleRate = newSampleRate;
+
+        for (auto* v : voices)
+            v->prepare (samplesPerBlockExpected, newSampleRate, numChannels);
+    }
+
+    void releaseResources() override
+    {
+        const juce::ScopedLock sl (lock);
+        waitForStragglers();
+
+        for (auto* v : voices)
+            v->release();
+    }
+
+    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        bufferToFill.clearActiveBufferRegion();
+
+        if (! playing)
+            return;
+
+        const juce::ScopedTryLock sl (lock);
+
+        if (! sl.isLocked())
+            return;
+
+        auto maxBlockSize = blockSize.load();
+
+        if (voices.isEmpty() || maxBlockSize <= 0)
+            return;
+
+        // hosts are allowed to send bigger blocks than they promised
+        for (int done = 0; done < bufferToFill.numSamples; done += maxBlockSize)
+        {
+            auto num = juce::jmin (maxBlockSize, bufferToFill.numSamples - done);
+            renderVoices (num);
+
+            for (int ch = 0; ch < juce::jmin (numChannels, bufferToFill.buffer->getNumChannels()); ++ch)
+            {
+                auto* dest = bufferToFill.buffer->getWritePointer (ch, bufferToFill.startSample + done);
+
+                // a voice still being rendered by a late worker drops out of
+                // this block rather than holding up the callback
+                for (auto* v : voices)
+                    if (v->hasRendered (blockNumber))
+                        juce::FloatVectorOperations::addWithMultiply (dest, v->getBuffer().getReadPointer (ch), v->getGain(), num);
+            }
+        }
+    }
+
+private:
+    void renderVoices (int numSamples)
+    {
+        ++blockNumber;
+
+        // parallelBlockNumber and samplesToRender are only rewritten once no
+        // worker is left over from the previous batch, so a late worker always
+        // sees the values of its own batch
+        if (voices.size() >= parallelThreshold && workers.getNumWorkers() > 0 && workers.isIdle())
+        {
+            parallelBlockNumber = blockNumber;
+            samplesToRender = numSamples;
+
+            // the unclaimed tasks are rendered on this thread anyway, so this is
+            // only how long to wait for the ones a worker is in the middle of
+            auto maxWaitMs = 500.0 * numSamples / sampleRate.load();
+
+            workers.run (voices.size(), [] (void* context, int index)
+            {
+                auto& mixer = *static_cast<MultiTrackMixer*> (context);
+                mixer.voices.getUnchecked (index)->renderBlock (mixer.parallelBlockNumber, mixer.samplesToRender);
+            }, this, maxWaitMs);
+        }
+        else
+        {
+            for (auto* v : voices)
+                v->renderBlock (blockNumber, numSamples);
+        }
+    }
+
+    // called with the lock held, before anything a late worker might be
+    // using is changed
+    void waitForStragglers() const
+    {
+        while (! workers.isIdle())
+            juce::Thread::sleep (1);
+    }
+
+    const int numChannels;
+    std::atomic<int> parallelThreshold;
+    std::atomic<bool> playing { false };
+    RealtimeWorkerPool workers;
+
+    juce::CriticalSection lock;
+    juce::OwnedArray<MixerVoice> voices;
+    std::atomic<int> blockSize { 0 };
+    std::atomic<double> sampleRate { 44100.0 };
+    int samplesToRender = 0;
+    juce::uint32 blockNumber = 0, parallelBlockNumber = 0;
+    float cutoff = 20000.0f, q = 0.1f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultiTrackMixer)
+};
+
+//==============================================================================
+/**
+    Finds how many looping noise voices the mixer can render in real time at a
+    given block size, allowing the callback a fraction of each block's
+    duration as headroom.
+*/
+struct MixerStressBenchmark
+{
+    struct Result
+    {
+        int maxVoices = 0, numThreads = 1, numRealtimeWorkers = 0;
+        double voicesPerCore = 0;
+    };
+
+    static Result run (int blockSize, double sampleRate, int numWorkerThreads,
+                       double cpuBudget = 0.7, int blocksPerMeasurement = 200)
+    {
+        juce::AudioBuffer<float> noise (2, (int) sampleRate);
+        juce::Random random;
+
+        for (int ch = 0; ch < noise.getNumChannels(); ++ch)
+            for (int i = 0; i < noise.getNumSamples(); ++i)
+                noise.setSample (ch, i, random.nextFloat() * 2.0f - 1.0f);
+
+        MultiTrackMixer mixer (2, numWorkerThreads, numWorkerThreads > 0 ? 2 : std::numeric_limits<int>::max());
+        mixer.prepareToPlay (blockSize, sampleRate);
+        mixer.setPlaying (true);
+
+        juce::AudioBuffer<float> output (2, blockSize);
+        auto budgetMs = cpuBudget * 1000.0 * blockSize / sampleRate;
+
+        std::vector<double> blockTimes ((size_t) blocksPerMeasurement);
+
+        // judged on the 99th percentile block, so one scheduler hiccup doesn't
+        // decide the result
+        auto fitsInBudget = [&] (int numVoices)
+        {
+            mixer.removeAllVoices();
+
+            for (int i = 0; i < numVoices; ++i)
+            {
+                auto voice = mixer.addVoice (std::make_unique<juce::MemoryAudioSource> (noise, false, true), sampleRate);
+                voice->setFilter (200.0f + 50.0f * (float) i, 0.7f);
+            }
+
+            for (auto& t : blockTimes)
+            {
+                auto start = juce::Time::getMillisecondCounterHiRes();
+                mixer.getNextAudioBlock ({ &output, 0, blockSize });
+                t = juce::Time::getMillisecondCounterHiRes() - start;
+            }
+
+            std::sort (blockTimes.begin(), blockTimes.end());
+            return blockTimes[(blockTimes.size() * 99) / 100] < budgetMs;
+        };
+
+        // double until it no longer fits, then bisect
+        int low = 0, high = 1;
+
+        while (fitsInBudget (high))
+        {
+            low = high;
+            high *= 2;
+        }
+
+        while (high - low > 1)
+        {
+            auto mid = (low + high) / 2;
+
+            if (fitsInBudget (mid))  low = mid;
+            else                     high = mid;
+        }
+
+        Result r;
+        r.maxVoices = low;
+        r.numThreads = mixer.getNumWorkerThreads() + 1;
+        r.numRealtimeWorkers = mixer.getNumRealtimeWorkerThreads();
+        r.voicesPerCore = (double) low / r.numThreads;
+        return r;
+    }
+};
@@ -29,6 +29,10 @@
 #include <algorithm>
 #pragma once
 
+#include "DecodeAheadSource.h"
+#include "FilterResponseOverlay.h"
+#include "MultiTrackMixer.h"
+
 //==============================================================================
 class MainContentComponent   : public juce::AudioAppComponent,
                                public juce::ChangeListener,
@@ -72,6 +76,13 @@ public:
         nextButton.onClick = [this] { nextButtonClicked(); };
         nextButton.setColour (juce::TextButton::buttonColourId, juce::Colours::darkblue);
         nextButton.setEnabled (false);
+
+        addAndMakeVisible (&layerButton);
+        layerButton.setButtonText ("Layer");
+        layerButton.setClickingTogglesState (true);
+        layerButton.onClick = [this] { layerButtonClicked(); };
+        layerButton.setColour (juce::TextButton::buttonOnColourId, juce::Colours::orange);
+        layerButton.setEnabled (false);
         
         addAndMakeVisible(&mySlider);
         mySlider.setSliderStyle(juce::Slider::SliderStyle::Rotary);
@@ -110,10 +121,15 @@ public:
         qLabel.attachToComponent (&qSlider, false);
 
 
+        decodeThread.startThread (juce::Thread::Priority::high);
         startTimerHz(20);
 
         setAudioChannels (0, 2);
         imageBoundaries = new juce::Rectangle<float>(0, getHeight()/3*2, getWidth(), getHeight()/3);
+
+        addAndMakeVisible(responseOverlay);
+        responseOverlay.setBounds(imageBoundaries->toNearestInt());
+        updateResponseOverlay();
         
        
         
@@ -125,24 +141,41 @@ public:
     ~MainContentComponent() override
     {
         shutdownAudio();
+        mixer.removeAllVoices();
+        transportSource.setSource (nullptr);
+        readerSource.reset();
+        decodeThread.stopThread (2000);
         
     }
 
+    // lets the decoded-audio cache be sized for the machine, e.g. from
+    // --cache-mb on the command line
+    void setCacheMemoryBudget (size_t maxBytes)
+    {
+        audioCache.setMemoryBudget (maxBytes);
+    }
+
     //========================================================================== GUI
     bool isInterestedInFileDrag(const juce::StringArray &files) override {
         for (const auto &f : files) {
-            if (f.endsWithIgnoreCase(".wav"))
+            if (isSupportedAudioFile(f))
                 return true;
         }
         return false;
     };
+
+    // anything registerBasicFormats() can decode: WAV, AIFF, FLAC, Ogg..
+    bool isSupportedAudioFile(const juce::String& path)
+    {
+        return formatManager.findFormatForFileExtension(juce::File(path).getFileExtension()) != nullptr;
+    }
     void filesDropped(const juce::StringArray &files, int x, int y) override
     {
        if(!files.isEmpty())
        {
            for (const auto &s : files)
            {
-               if (s.endsWithIgnoreCase(".wav"))
+               if (isSupportedAudioFile(s))
                {
                    auto myFile = juce::File(s);
                    
@@ -156,19 +189,7 @@ public:
                        trackListIndex++;
                        
                        if (tracks.size() == 1)
-                       {
-                            auto reader = formatManager.createReaderFor(tracks[tracksQueue]);
-                            
-                            if (reader != nullptr)
-                            {
-                                auto newSource = std::make_unique<juce::AudioFormatReaderSource>        (reader, true);
-                                transportSource.setSource (newSource.get(), 0, nullptr,         reader->sampleRate);
-                                playButton.setEnabled (true);
-                                readerSource.reset (newSource.release());
-                                trackIsOn = true;
-                               
-                            }
-                        }
+                            loadTrack (tracksQueue);
                    }
                    else
                    {
@@ -177,6 +198,8 @@ public:
                    }
                }
            }
+
+           prefetchNeighbouringTracks();
        }
     };
     
@@ -190,6 +213,7 @@ public:
         stopButton.setBounds (oneSixthhWidth*4, 10, buttonWidth, 20);
         prevButton.setBounds (oneSixthhWidth*2, 35, buttonWidth, 20);
         nextButton.setBounds (oneSixthhWidth*3, 35, buttonWidth, 20);
+        layerButton.setBounds (oneSixthhWidth*4.5, 35, buttonWidth, 20);
         mySlider.setBounds (60, 80, 50, 50);
         qSlider.setBounds(getWidth()-110, 80, 50, 50);
         tracksContainer.setBounds(0, 140, getWidth(), 100);
@@ -213,7 +237,7 @@ public:
 
         for (auto y = 1; y < imageHeight; ++y)
         {
-            auto skewedProportionY = 1.0f - std::exp(std::log((float)y / (float)imageHeight) * 0.2f);
+            auto skewedProportionY = FilterResponseOverlay::getSkewedProportionY((float)y / (float)imageHeight);
             auto fftDataIndex = (size_t)juce::jlimit(0, fftSize / 2, (int)(skewedProportionY * fftSize / 2));
             auto level = juce::jmap(fftData[fftDataIndex], 0.0f, juce::jmax(maxLevel.getEnd(), 1e-5f), 0.0f, 1.0f);
 
@@ -248,9 +272,32 @@ public:
         g.setOpacity(1.0f);
         
         g.drawImage(spectrogramImage, *imageBoundaries);
+
+        auto stats = audioCache.getStatistics();
+        g.setColour (juce::Colours::white.withAlpha (0.6f));
+        g.setFont (10.0f);
+        g.drawText ("cache " + juce::String (stats.hits) + " hits / " + juce::String (stats.misses) + " misses / "
+                      + juce::String (stats.evictions) + " evictions, "
+                      + juce::String ((double) stats.bytesInUse / (1024.0 * 1024.0), 1) + " of "
+                      + juce::String ((double) stats.memoryBudget / (1024.0 * 1024.0), 0) + " MB, "
+                      + juce::String (getNumUnderruns()) + " underruns",
+                    imageBoundaries->reduced (4.0f), juce::Justification::topLeft);
         
     }
     
+    // the single track's underruns plus those of every layered voice, since
+    // both playback paths decode ahead
+    int getNumUnderruns() const
+    {
+        auto total = readerSource != nullptr ? readerSource->getNumUnderruns() : 0;
+
+        for (int i = 0; i < mixer.getNumVoices(); ++i)
+            if (auto* voiceSource = dynamic_cast<DecodeAheadSource*> (mixer.getVoice (i)->getSource()))
+                total += voiceSource->getNumUnderruns();
+
+        return total;
+    }
+
     //========================================================================== AUDIO
     void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
     {
@@ -258,6 +305,8 @@ public:
         auto totalNumOutputChannels = device->getActiveOutputChannels().getHighestBit() + 1;
 
         transportSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
+        mixer.prepareToPlay (samplesPerBlockExpected, sampleRate);
+        currentSampleRate = sampleRate;
         dsp::ProcessSpec spec;
         spec.sampleRate = sampleRate;
         spec.maximumBlockSize = samplesPerBlockExpected;
@@ -269,21 +318,29 @@ public:
 
     void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
     {
-        if (readerSource.get() == nullptr)
+        if (layering)
         {
-            bufferToFill.clearActiveBufferRegion();
-            return;
+            // every voice runs its own filter, so lp1 is bypassed here
+            mixer.getNextAudioBlock (bufferToFill);
         }
+        else
+        {
+            if (readerSource.get() == nullptr)
+            {
+                bufferToFill.clearActiveBufferRegion();
+                return;
+            }
 
-        transportSource.getNextAudioBlock (bufferToFill);
-        
-        AudioBuffer<float> procBuf(bufferToFill.buffer->getArrayOfWritePointers(),
-            bufferToFill.buffer->getNumChannels(),
-            bufferToFill.startSample,
-            bufferToFill.numSamples);
+            transportSource.getNextAudioBlock (bufferToFill);
 
-        MidiBuffer midi;
-        processBlock(procBuf, midi);
+            AudioBuffer<float> procBuf(bufferToFill.buffer->getArrayOfWritePointers(),
+                bufferToFill.buffer->getNumChannels(),
+                bufferToFill.startSample,
+                bufferToFill.numSamples);
+
+            MidiBuffer midi;
+            processBlock(procBuf, midi);
+        }
 
         if (bufferToFill.buffer->getNumChannels() > 0)
         {
@@ -304,12 +361,22 @@ public:
     
     void updateFilter()
     {
-        *lp1.state = *dsp::IIR::Coefficients<float>::makeLowPass(44100, lolsky, qsky);
+        *lp1.state = *dsp::IIR::Coefficients<float>::makeLowPass(currentSampleRate, lolsky, qsky);
+    }
+
+    // only called when a parameter changes; the overlay itself skips the
+    // work if the coefficients come out the same
+    void updateResponseOverlay()
+    {
+        overlaySampleRate = currentSampleRate;
+        responseOverlay.setCoefficients(dsp::IIR::Coefficients<float>::makeLowPass(overlaySampleRate, lolsky, qsky),
+                                        overlaySampleRate);
     }
 
     void releaseResources() override
     {
         transportSource.releaseResources();
+        mixer.releaseResources();
     }
 
     void changeListenerCallback (juce::ChangeBroadcaster* source) override
@@ -343,55 +410,116 @@ public:
         if (tracksQueue > 0)
         {
             tracksQueue--;
-            auto reader = formatManager.createReaderFor(tracks[tracksQueue]);
-            
-            if (reader != nullptr)
-            {
-                auto newSource = std::make_unique<juce::AudioFormatReaderSource> (reader, true);
-                transportSource.setSource (newSource.get(), 0, nullptr, reader->sampleRate);
-                playButton.setEnabled (true);
-                readerSource.reset (newSource.release());
-                trackIsOn = true;
-                if (state == Playing)
-                {
-                    transportSource.start();
-                }
-            }
+
+            if (loadTrack (tracksQueue) && state == Playing)
+                transportSource.start();
         }
     }
     
     void nextButtonClicked()
     {
-        if (tracksQueue < tracks.size())
+        if (tracksQueue + 1 < (int) tracks.size())
         {
             tracksQueue++;
-            auto reader = formatManager.createReaderFor(tracks[tracksQueue]);
-            
-            if (reader != nullptr)
-            {
-                auto newSource = std::make_unique<juce::AudioFormatReaderSource> (reader, true);
-                transportSource.setSource (newSource.get(), 0, nullptr, reader->sampleRate);
-                playButton.setEnabled (true);
-                readerSource.reset (newSource.release());
-                trackIsOn = true;
-                if (state == Playing)
-                {
-                    transportSource.start();
-                }
-            }
+
+            if (loadTrack (tracksQueue) && state == Playing)
+                transportSource.start();
         }
     }
     
+    // plays every track in the list at once, each through its own filter; the
+    // transport buttons start, pause and stop the layered voices as well
+    void layerButtonClicked()
+    {
+        if (! layerButton.getToggleState())
+        {
+            layering = false;
+            mixer.removeAllVoices();
+            return;
+        }
+
+        mixer.removeAllVoices();
+        mixer.setFilterForAllVoices (lolsky, qsky);
+
+        for (auto& track : tracks)
+        {
+            auto cachedSource = std::make_unique<CachingAudioSource> (audioCache, formatManager, track, true);
+
+            if (! cachedSource->isValid())
+                continue;
+
+            auto sampleRate = cachedSource->getSampleRate();
+            auto numChannels = cachedSource->getNumChannels();
+            mixer.addVoice (std::make_unique<DecodeAheadSource> (std::move (cachedSource), decodeThread, numChannels,
+                                                                 (int) sampleRate),
+                            sampleRate);
+        }
+
+        // keeps the summed level roughly where a single track would be
+        auto gain = 1.0f / std::sqrt ((float) juce::jmax (1, mixer.getNumVoices()));
+
+        for (int i = 0; i < mixer.getNumVoices(); ++i)
+            mixer.getVoice (i)->setGain (gain);
+
+        layering = true;
+    }
+
+    bool loadTrack (int index)
+    {
+        auto cachedSource = std::make_unique<CachingAudioSource> (audioCache, formatManager, tracks[(size_t) index], true);
+
+        if (! cachedSource->isValid())
+            return false;
+
+        auto sampleRate = cachedSource->getSampleRate();
+        auto numChannels = cachedSource->getNumChannels();
+
+        // decoding (FLAC, Ogg..) happens on decodeThread; the audio callback
+        // only copies out of the read-ahead buffer
+        auto newSource = std::make_unique<DecodeAheadSource> (std::move (cachedSource), decodeThread, numChannels,
+                                                              (int) sampleRate);
+
+        transportSource.setSource (newSource.get(), 0, nullptr, sampleRate);
+        playButton.setEnabled (true);
+        readerSource.reset (newSource.release());
+        trackIsOn = true;
+        prefetchNeighbouringTracks();
+        return true;
+    }
+
+    // decodes the start of the next and previous tracks in the background, so
+    // Prev/Next can play straight out of the cache
+    void prefetchNeighbouringTracks()
+    {
+        juce::Array<juce::File> files;
+
+        if (tracksQueue + 1 < (int) tracks.size())
+            files.add (tracks[(size_t) tracksQueue + 1]);
+
+        if (tracksQueue > 0)
+            files.add (tracks[(size_t) tracksQueue - 1]);
+
+        prefetcher.setFilesToPrefetch (files);
+    }
+
     void sliderValueChanged()
     {
         lolsky = mySlider.getValue();
+        mixer.setFilterForAllVoices (lolsky, qsky);
+        updateResponseOverlay();
     }
     
     void qSliderValueChanged()
     {
         qsky = qSlider.getValue();
+        mixer.setFilterForAllVoices (lolsky, qsky);
+        updateResponseOverlay();
     }
 
+    // shared with the offline analysis, so its frames match the spectrogram's
+    static constexpr auto fftOrder = 10;
+    static constexpr auto fftSize = 1 << fftOrder;
+
 private:
     enum TransportState
     {
@@ -415,11 +543,13 @@ private:
                     pauseButton.setEnabled(false);
                     playButton.setEnabled (true);
                     transportSource.setPosition (fratm);
+                    mixer.setPlaying (false);
                     break;
 
                 case Starting:
                     playButton.setEnabled (false);
                     transportSource.start();
+                    mixer.setPlaying (true);
                     break;
 
                 case Playing:
@@ -429,6 +559,8 @@ private:
 
                 case Stopping:
                     transportSource.stop();
+                    mixer.setPlaying (false);
+                    mixer.setPositionForAllVoices (0.0);
                     fratm = 0.0;
                     break;
                     
@@ -438,6 +570,7 @@ private:
                     transportSource.setPosition(fratm);
                     std::cout << fratm;
                     transportSource.stop();
+                    mixer.setPlaying (false);
                     break;
             }
         }
@@ -470,6 +603,9 @@ private:
             nextFFTBlockReady = false;
             repaint();
         }
+
+        if (overlaySampleRate != currentSampleRate)
+            updateResponseOverlay();
         
         if (tracksQueue > 0)
             prevButton.setEnabled(true);
@@ -480,6 +616,13 @@ private:
             nextButton.setEnabled(true);
         else
             nextButton.setEnabled(false);
+
+        layerButton.setEnabled(tracks.size() > 1);
+
+        // the transport isn't pulled while layering, so it can't report the
+        // end of the stream itself
+        if (layering && state == Playing && mixer.haveAllVoicesFinished())
+            changeState (Stopping);
         
         for (int i = 0; i < 16; i++)
         {
@@ -491,18 +634,19 @@ private:
        
     }
     
-    static constexpr auto fftOrder = 10;
-    static constexpr auto fftSize = 1 << fftOrder;
-    
     //==========================================================================
-    juce::TextButton pauseButton, playButton, stopButton, prevButton, nextButton;
+    juce::TextButton pauseButton, playButton, stopButton, prevButton, nextButton, layerButton;
     juce::Slider mySlider, qSlider;
     juce::Label  frequencyLabel, qLabel;
     std::array<TextButton, 16> trackList;
     std::unique_ptr<juce::FileChooser> chooser;
     juce::Component tracksContainer;
     juce::AudioFormatManager formatManager;
-    std::unique_ptr<juce::AudioFormatReaderSource> readerSource;
+    DecodedAudioCache audioCache;
+    CachePrefetcher prefetcher { audioCache, formatManager };
+    juce::TimeSliceThread decodeThread { "Audio Decode" };
+    std::unique_ptr<DecodeAheadSource> readerSource;
+    MultiTrackMixer mixer;
     juce::AudioTransportSource transportSource;
     TransportState state;
     
@@ -516,6 +660,7 @@ private:
     int tracksQueue = 0;
     int trackListIndex = 0;
     juce::Rectangle<float>* imageBoundaries;
+    FilterResponseOverlay responseOverlay;
     
     //juce::OpenGLContext openGLContext;
     
@@ -523,8 +668,11 @@ private:
     std::array<float, fftSize * 2> fftData;
     int fifoIndex = 0;
     std::atomic_bool nextFFTBlockReady = ATOMIC_VAR_INIT(false);
+    std::atomic_bool layering { false };
     float lolsky = 20000;
     float qsky = 0.1f;
+    std::atomic<double> currentSampleRate { 44100.0 };   // written by the device thread, read by the timer
+    double overlaySampleRate = 0.0;
     float fratm = 0.0;
     bool trackIsOn = false;
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)